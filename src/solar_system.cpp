@@ -5,10 +5,20 @@
 #include <ctime> 
 #include <random> 
 #include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <limits>
 #include <iostream>
-#include <GL/glut.h>
+#include <GL/freeglut.h>
 #include <vmath>
 #include <v3d>
+#include <vsim>
+#include <vcap>
+#include <vprof>
+#ifdef SOLAR_SYSTEM_HAVE_EGL
+#include <vegl>
+#endif
 
 static char const *helpPrompt[] = {"Press F1 for help", 0};
 static char const *helpText[] = {
@@ -21,10 +31,20 @@ static char const *helpText[] = {
 	"Toggle switchTrails: t",
 	"Toggle switchRotate: r",
 	"Toggle animation: space",
+	"Toggle profiler: p",
+	"Start / write trace: j",
+	"Time warp: + / -",
 	"Quit: escape",
 	0
 };
 
+void initGL();
+void initMeshes();
+double currentSeconds();
+void swapBuffers();
+int  runHeadless();
+bool saveScreenshot(char const * path);
+void finishCapture();
 void idle();
 void display();
 void reshape(int x, int y);
@@ -34,6 +54,11 @@ void mouse(int bn, int st, int x, int y);
 void motion(int x, int y);
 void printHelp();
 void printFps();
+void printProfile();
+void reportProfile(FILE * out);
+int  runBenchmark();
+void writeTrace();
+void renderFrame();
 
 void renderSun();
 void renderMercury();
@@ -45,12 +70,17 @@ void renderSaturn();
 void renderUranus();
 void renderNeptune();
 void renderSolarSystem(); 
-void renderText(char const * text, float position[2]);
+void initStars();
+void initSolarSystem();
+void renderText(char const * text, vm::mat4 const & mModel, float position[2]);
+void queueMesh(int mesh, int material, vm::mat4 const & mModel);
 
-float lastTime      = 0.f;
-float elapsedTime   = 0.f;
-float deltaTime     = 0.f;
-float lastFrameTime = 0.f;
+double lastTime      = 0.0;
+double elapsedTime   = 0.0; // simulation clock, seconds
+float  deltaTime     = 0.f;
+double lastFrameTime = 0.0;
+float  timeWarp      = 1.f;
+float  fixedDeltaTime = 0.f; // when set, every frame advances the clock by this many seconds
 float fps     = 0.f;
 long  nFrames = 0;
 
@@ -61,6 +91,12 @@ float camPhi    = 25;
 float camDist   = 8;
 float camPan[3] = {};
 float camScale  = 1.f/5.f;
+vm::vec3d renderOrigin; // world point the scene is drawn relative to, follows the camera pan
+vm::mat4 mCamera;
+vm::mat4 mProjection;
+vm::mat4 mViewProjection;       // mProjection * mCamera
+vm::frustum_planes viewFrustum; // of mViewProjection, relative to the render origin
+v3d::Text text(9, 16, 4); // GLUT_BITMAP_9_BY_15 cells
 int mouseX = 0;
 int mouseY = 0;
 bool buttonState[8]  = {};
@@ -70,6 +106,25 @@ bool switchTrails    = true;
 bool switchRotate    = true;
 bool switchHelp      = false;
 
+// frame stages, timed while the profiler is on ('p' or --profile).
+vprof::Profiler profiler;
+int stageEvents     = profiler.stage("events", false);
+int stageFrame      = profiler.stage("frame", false);
+int stageSimulation = profiler.stage("simulation");
+int stageBackground = profiler.stage("background");
+int stageTrails     = profiler.stage("trails");
+int stageBodies     = profiler.stage("bodies");
+int stageAsteroids  = profiler.stage("asteroids");
+int stageSubmit     = profiler.stage("submit");
+int stageHud        = profiler.stage("hud");
+int stageText       = profiler.stage("text");
+int stageCapture    = profiler.stage("capture");
+int stageSwap       = profiler.stage("swap", false);
+bool profileAtStart = false;
+// every timed stage with timestamps, for offline viewing in chrome://tracing or perfetto ('j' or --trace).
+vprof::Trace trace;
+char const * tracePath = "solar_system.trace.json";
+
 float orbitDurationMercury = 88.f;
 float orbitDurationVenus = 225.f;
 float orbitDurationEarth = 365.f;
@@ -95,28 +150,132 @@ float orbitOffsetNeptune = 0.2f;
 float orbitDurationPerSec = orbitDurationEarth / 20.f;
 float starDistance = 200.f;
 int   numStars     = 1000;
-std::vector<vm::vec3> starGens;
+v3d::StarField starField(2.f);
+unsigned int randomSeed = std::random_device{}(); // stars and asteroids, --seed makes runs repeatable
+
+// body table order, parents first. minor bodies follow the named ones.
+enum Body { SUN, MERCURY, VENUS, EARTH, MOON, MARS, JUPITER, SATURN, URANUS, NEPTUNE, NUM_BODIES };
+vsim::System solarSystem(orbitDurationPerSec);
+int   numAsteroids = 2000;
+v3d::StarField asteroidField(1.5f);
+bool  labelAsteroids = false;
+vm::soa3 asteroidPositions;                // this frame's, relative to the render origin
+std::vector<unsigned char> asteroidVisible; // label culling, one flag per asteroid
+int   trailSamples = 1440; // per full orbit
+float trailSpan    = 50.f; // degrees of mean anomaly behind the body
+std::vector<v3d::Trail> trails;
+
+// planets, rings and halos are emitted into the queue while the scene is walked, then drawn sorted.
+v3d::RenderQueue renderQueue;
+// --shaders lights the queued bodies per pixel with GLSL 3.30 instead of fixed function lighting.
+bool useShaders = false;
+v3d::LitShader litShader;
+v3d::Light sunLight;
+// with shaders on GL 4.3, the queued bodies are drawn from one pooled buffer in two multi draws.
+// --no-multidraw keeps one draw per body, for comparison.
+bool useMultiDraw = true;
+v3d::MeshPool meshPool;
+// one set of unit spheres for every body, the level follows the size on screen.
+v3d::SphereLod sphereLod;
+int sphereLevels[NUM_BODIES][4] = {}; // last frame's level per body, layers 1 to 3 are the sun's halos
+std::vector<int> sphereMeshes;        // render queue ids of the levels
+// geometry shared between bodies, built by initMeshes() before the first frame.
+v3d::MeshRegistry meshRegistry;
+// planetary rings in world units, meshes per ringed body.
+struct Ring {
+    float radius = 0.f;
+    float size   = 0.f;
+    v3d::MeshRegistry::Handle handle;
+    int   mesh   = -1; // render queue id
+};
+Ring rings[NUM_BODIES];
+
+// --headless renders a fixed number of frames offscreen through EGL, without a window or display.
+// --capture records numFrames frames at a fixed 1/captureFps timestep, in either mode.
+bool headless        = false;
+int  headlessWidth   = 1280;
+int  headlessHeight  = 720;
+int const maxHeadlessSize = 16384; // GL_MAX_VIEWPORT_DIMS is unknown before the context exists
+int  numFrames       = 600;
+char const * screenshotPath = nullptr;
+char const * capturePath    = nullptr;
+float captureFps = 60.f;
+vcap::Recorder recorder;
+#ifdef SOLAR_SYSTEM_HAVE_EGL
+vegl::Context headlessContext;
+#endif
+
+// --benchmark renders each scenario headless from the same seed and a fixed timestep, and prints
+// one json line of frame time percentiles per scenario. frames are timed to glFinish.
+struct Scenario {
+    char const * name;
+    int  stars;
+    int  asteroids;
+    bool labelAll; // every body, asteroids included
+};
+Scenario const scenarios[] = {
+    { "default",      1000,   2000,  false },
+    { "stars100k",    100000, 2000,  false },
+    { "asteroids10k", 1000,   10000, false },
+    { "labels",       1000,   2000,  true  },
+};
+char const * benchmarkScenario = nullptr; // a name from the table or "all"
+unsigned int benchmarkSeed     = 1;
+int          warmupFrames      = 60;
 
 /***********************************************************/
 
 int main(int argc, char *argv[])
 {
-    // generate random star coordinates to project onto sphere.  
-    { 
-        starGens.reserve(numStars);
-        std::random_device rd; // obtain a random number from hardware
-        std::mt19937 gen(rd()); // seed the generator
-        std::uniform_real_distribution<float> distR(.2f, .3f);
-        std::uniform_real_distribution<float> distZ(0.f, 360.f);
-        std::uniform_real_distribution<float> distY(0.f, 360.f);
-        for(int i = 0; i < numStars; i++)
+    for(int i = 1; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if(std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            numFrames = std::atoi(argv[++i]);
+        else if(std::strcmp(argv[i], "--size") == 0 && i + 1 < argc)
         {
-            float radius = distR(gen);
-            float y = distY(gen);
-            float z = distZ(gen);
-            starGens.push_back({radius, y, z});
+            char rest;
+            if(std::sscanf(argv[++i], "%dx%d%c", &headlessWidth, &headlessHeight, &rest) != 2
+            || headlessWidth <= 0 || headlessWidth > maxHeadlessSize
+            || headlessHeight <= 0 || headlessHeight > maxHeadlessSize)
+            {
+                std::fprintf(stderr, "usage: --size WIDTHxHEIGHT, 1 to %d each, not %s\n", maxHeadlessSize, argv[i]);
+                return 1;
+            }
+        }
+        else if(std::strcmp(argv[i], "--screenshot") == 0 && i + 1 < argc)
+            screenshotPath = argv[++i];
+        else if(std::strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+            capturePath = argv[++i];
+        else if(std::strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+            captureFps = vm::max(float(std::atof(argv[++i])), 1.f);
+        else if(std::strcmp(argv[i], "--profile") == 0)
+            profileAtStart = true;
+        else if(std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            tracePath = argv[++i];
+            trace.start();
+        }
+        else if(std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            randomSeed = benchmarkSeed = unsigned(std::strtoul(argv[++i], nullptr, 10));
+        else if(std::strcmp(argv[i], "--shaders") == 0)
+            useShaders = true;
+        else if(std::strcmp(argv[i], "--no-multidraw") == 0)
+            useMultiDraw = false;
+        else if(std::strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+        {
+            benchmarkScenario = argv[++i];
+            headless = true;
         }
     }
+    profiler.setTrace(&trace);
+    // 'q' and closing the window leave through exit(), a running trace is written on the way out.
+    std::atexit(writeTrace);
+    initStars();
+    initSolarSystem();
+    if(headless)
+        return runHeadless();
 
     glutInit(&argc, argv);
 	glutInitWindowSize(800, 600);
@@ -130,6 +289,204 @@ int main(int argc, char *argv[])
 	glutMouseFunc(mouse);
 	glutMotionFunc(motion);
 
+    v3d::gl::load(glutGetProcAddress);
+    text.build([](char ch) { glutBitmapCharacter(GLUT_BITMAP_9_BY_15, ch); });
+    initGL();
+    profiler.setEnabled(profileAtStart);
+
+    // for animation
+    {
+        lastTime = currentSeconds();
+        glutIdleFunc(switchAnimation ? idle : 0);
+    }
+
+	glutMainLoop();
+	return 0;
+}
+
+// no window and no glut: the bitmap font is unavailable, so text is skipped.
+int runHeadless()
+{
+#ifdef SOLAR_SYSTEM_HAVE_EGL
+    if(!headlessContext.create(headlessWidth, headlessHeight))
+    {
+        std::fprintf(stderr, "headless: could not create an EGL context (error 0x%x)\n", headlessContext.getError());
+        return 1;
+    }
+    v3d::gl::load(eglGetProcAddress);
+    initGL();
+    if(benchmarkScenario != nullptr)
+    {
+        int result = runBenchmark();
+        headlessContext.destroy();
+        return result;
+    }
+    profiler.setEnabled(profileAtStart);
+    reshape(headlessWidth, headlessHeight);
+    std::printf("headless: %dx%d, %s, %s, %s lighting%s\n", headlessWidth, headlessHeight, 
+                glGetString(GL_RENDERER), glGetString(GL_VERSION), renderQueue.getShader() != nullptr ? "shader" : "fixed function",
+                renderQueue.isMultiDraw() ? ", multi draw indirect" : "");
+    lastTime = currentSeconds();
+    double const start = lastTime;
+    for(int i = 0; i < numFrames; i++)
+        display();
+    if(recorder.isRecording())
+        finishCapture();
+    glFinish();
+    double const seconds = currentSeconds() - start;
+    std::printf("headless: %d frames in %.3f s, %.3f ms/frame\n", numFrames, seconds, 
+                numFrames > 0 ? seconds * 1000.0 / numFrames : 0.0);
+    if(numFrames > 0)
+        std::printf("headless: material state calls per frame, %.1f sent, %.1f skipped\n", 
+                    double(renderQueue.getMaterialCache().getIssued()) / numFrames, 
+                    double(renderQueue.getMaterialCache().getSkipped()) / numFrames);
+    if(numFrames > 0)
+        std::printf("headless: render queue draw calls per frame, %.1f\n", double(renderQueue.getDrawCalls()) / numFrames);
+    if(profiler.isEnabled())
+        reportProfile(stdout);
+    writeTrace();
+    if(screenshotPath != nullptr && !saveScreenshot(screenshotPath))
+    {
+        std::fprintf(stderr, "headless: could not write %s\n", screenshotPath);
+        return 1;
+    }
+    profiler.release();
+    headlessContext.destroy();
+    return 0;
+#else
+    std::fprintf(stderr, "headless: not available, built without EGL\n");
+    return 1;
+#endif
+}
+
+int runBenchmark()
+{
+#ifdef SOLAR_SYSTEM_HAVE_EGL
+    // without glut there is no bitmap font. box glyphs stand in, so labels cost the same quads and fill.
+    {
+        GLubyte const box[12] = { 0xff, 0x81, 0x81, 0x81, 0x81, 0x81, 0x81, 0x81, 0x81, 0x81, 0x81, 0xff };
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        text.build([&](char) { glBitmap(8, 12, 0.f, 0.f, 9.f, 0.f, box); });
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    reshape(headlessWidth, headlessHeight);
+    std::fprintf(stderr, "benchmark: %dx%d, %s, %s\n", headlessWidth, headlessHeight, 
+                 glGetString(GL_RENDERER), glGetString(GL_VERSION));
+    bool const all = std::strcmp(benchmarkScenario, "all") == 0;
+    int ran = 0;
+    for(Scenario const & scenario : scenarios)
+    {
+        if(!all && std::strcmp(benchmarkScenario, scenario.name) != 0)
+            continue;
+        // same world, same camera path and same clock on every run.
+        randomSeed     = benchmarkSeed;
+        numStars       = scenario.stars;
+        numAsteroids   = scenario.asteroids;
+        labelAsteroids = scenario.labelAll;
+        switchLabels = switchTrails = switchRotate = switchAnimation = true;
+        fixedDeltaTime = 1.f / 60.f;
+        elapsedTime = 0.0;
+        camTheta    = 0.f;
+        initStars();
+        initSolarSystem();
+
+        std::vector<double> frameTimes;
+        frameTimes.reserve(numFrames);
+        for(int i = 0; i < warmupFrames + numFrames; i++)
+        {
+            auto const start = std::chrono::steady_clock::now();
+            display();
+            glFinish();
+            if(i >= warmupFrames)
+                frameTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        if(frameTimes.empty())
+            frameTimes.push_back(0.0);
+        double total = 0.0;
+        for(double t : frameTimes)
+            total += t;
+        std::sort(frameTimes.begin(), frameTimes.end());
+        // nearest rank
+        auto percentile = [&](double p) {
+            std::size_t rank = std::size_t(std::ceil(p / 100.0 * double(frameTimes.size())));
+            return frameTimes[rank > 0 ? rank - 1 : 0];
+        };
+        std::printf("{\"scenario\":\"%s\",\"width\":%d,\"height\":%d,\"frames\":%d,\"warmup\":%d,\"seed\":%u"
+                    ",\"stars\":%d,\"asteroids\":%d,\"dt\":%.6f"
+                    ",\"mean_ms\":%.4f,\"min_ms\":%.4f,\"p50_ms\":%.4f,\"p90_ms\":%.4f,\"p95_ms\":%.4f"
+                    ",\"p99_ms\":%.4f,\"max_ms\":%.4f}\n"
+                    , scenario.name, headlessWidth, headlessHeight, int(frameTimes.size()), warmupFrames, benchmarkSeed
+                    , numStars, numAsteroids, fixedDeltaTime
+                    , total / double(frameTimes.size()), frameTimes.front(), percentile(50.0), percentile(90.0)
+                    , percentile(95.0), percentile(99.0), frameTimes.back());
+        std::fflush(stdout);
+        ran++;
+    }
+    // last frame of the last scenario, to check that builds still draw the same picture.
+    if(ran > 0 && screenshotPath != nullptr && !saveScreenshot(screenshotPath))
+    {
+        std::fprintf(stderr, "benchmark: could not write %s\n", screenshotPath);
+        return 1;
+    }
+    if(ran == 0)
+    {
+        std::fprintf(stderr, "benchmark: unknown scenario %s, expected all", benchmarkScenario);
+        for(Scenario const & scenario : scenarios)
+            std::fprintf(stderr, ", %s", scenario.name);
+        std::fprintf(stderr, "\n");
+        return 1;
+    }
+    return 0;
+#else
+    return 1;
+#endif
+}
+
+// current read buffer to a ppm, png or raw file, chosen by extension.
+bool saveScreenshot(char const * path)
+{
+    std::vector<unsigned char> rgba(std::size_t(windowWidth) * windowHeight * 4);
+    std::vector<unsigned char> rgb(std::size_t(windowWidth) * windowHeight * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, windowWidth, windowHeight, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+    vcap::rgba_to_rgb_flipped(rgba.data(), windowWidth, windowHeight, rgb.data());
+    return vcap::write_image(path, rgb.data(), windowWidth, windowHeight);
+}
+
+void finishCapture()
+{
+    bool ok = recorder.finish();
+    std::printf("capture: %ld of %ld frames written to %s\n", 
+                recorder.getWrittenCount(), recorder.getFrameCount(), capturePath);
+    if(!ok)
+        std::fprintf(stderr, "capture: writing %s failed, capture stopped\n", capturePath);
+}
+
+double currentSeconds()
+{
+    if(headless)
+    {
+        static auto const start = std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return glutGet(GLUT_ELAPSED_TIME) / 1000.0;
+}
+
+void swapBuffers()
+{
+#ifdef SOLAR_SYSTEM_HAVE_EGL
+    if(headless)
+    {
+        headlessContext.swap();
+        return;
+    }
+#endif
+    glutSwapBuffers();
+}
+
+// fixed function state shared by the window and the headless context.
+void initGL()
+{
     glEnable(GL_LINE_SMOOTH);
     glEnable(GL_POLYGON_SMOOTH);
 	glEnable(GL_DEPTH_TEST);
@@ -142,6 +499,8 @@ int main(int argc, char *argv[])
 	glEnable(GL_COLOR_MATERIAL);
 	glEnable(GL_LIGHT0);
     glShadeModel(GL_SMOOTH);
+    renderQueue.init();
+    initMeshes();
 
     // initialize light0 parameters
     {
@@ -150,310 +509,372 @@ int main(int argc, char *argv[])
         float b = .8f;
         float ambientFactor = .05f;
         float specularFactor = .7f;
-        float lightAmbient[] = {r*ambientFactor, g*ambientFactor,b*ambientFactor, 1.f};
-        float lightDiffuse[] = {r, g, b, 1.f};
-        float lightSpecular[] = {r*specularFactor, g*specularFactor,b*specularFactor, 1.f};
-        glLightfv(GL_LIGHT0, GL_AMBIENT, lightAmbient);
-        glLightfv(GL_LIGHT0, GL_DIFFUSE, lightDiffuse);
-        glLightfv(GL_LIGHT0, GL_SPECULAR, lightSpecular);
-        glLightf(GL_LIGHT0, GL_CONSTANT_ATTENUATION, 4.0f);
-        glLightf(GL_LIGHT0, GL_LINEAR_ATTENUATION, 1.0f);
-        glLightf(GL_LIGHT0, GL_QUADRATIC_ATTENUATION, 0.25f);
+        sunLight.ambient  = {r*ambientFactor, g*ambientFactor,b*ambientFactor, 1.f};
+        sunLight.diffuse  = {r, g, b, 1.f};
+        sunLight.specular = {r*specularFactor, g*specularFactor,b*specularFactor, 1.f};
+        sunLight.constantAttenuation  = 4.0f;
+        sunLight.linearAttenuation    = 1.0f;
+        sunLight.quadraticAttenuation = 0.25f;
+        sunLight.apply(GL_LIGHT0);
     }
 
-    // for animation
+    if(useShaders)
     {
-        lastTime = glutGet(GLUT_ELAPSED_TIME) / 1000.f;
-        glutIdleFunc(switchAnimation ? idle : 0);
+        if(litShader.create())
+            renderQueue.setShader(&litShader);
+        else
+            std::fprintf(stderr, "shaders: %s\nshaders: falling back to fixed function lighting\n", litShader.getLog().c_str());
+        if(useMultiDraw && litShader.ready() && v3d::gl::api().multiDrawIndirect && !litShader.hasIndirect())
+            std::fprintf(stderr, "shaders: %s\nshaders: drawing bodies one by one\n", litShader.getIndirectLog().c_str());
     }
+}
 
-	glutMainLoop();
-	return 0;
+// every mesh the frame draws, built and uploaded here so no frame pays for it.
+void initMeshes()
+{
+    if(sphereMeshes.empty())
+    {
+        for(std::size_t i = 0; i < sphereLod.size(); i++)
+        {
+            sphereLod.level(int(i)).upload();
+            sphereMeshes.push_back(renderQueue.addMesh(sphereLod.level(int(i)), meshPool.add(sphereLod.level(int(i)))));
+        }
+    }
+    auto ring = [](int body, float ringRadius, float ringSize) {
+        float radius = solarSystem.body(body).radius;
+        Ring & r = rings[body];
+        meshRegistry.release(r.handle);
+        r.radius = ringRadius;
+        r.size   = ringSize;
+        // glutSolidTorus(ringSize/radius, ringRadius/radius, 2, 45);
+        r.handle = meshRegistry.torus(ringSize/radius, ringRadius/radius, 45, 2);
+        v3d::SolidTorus & torus = *meshRegistry.get<v3d::SolidTorus>(r.handle);
+        r.mesh   = renderQueue.addMesh(torus, meshPool.add(torus));
+    };
+    ring(SATURN, .9f, .14f);
+    ring(URANUS, .7f, .05f);
+    meshRegistry.upload();
+    // the pool only pays off with the shader path, see initGL().
+    if(useShaders && useMultiDraw && meshPool.upload())
+        renderQueue.setMeshPool(&meshPool);
 }
 
 /////////////////////////////////////////////////
 
-struct Material {
-    vm::vec4 diffuse;
-    vm::vec4 emission = {0.f, 0.f, 0.f, 1.f};
-    vm::vec4 ambient  = diffuse;
-    vm::vec4 specular = {diffuse.x, diffuse.y, diffuse.z, .5f};
-    // vm::vec4 specular = {1.f, 1.f, 1.f, .3f};
-};
+// random star coordinates projected onto a sphere, baked once into the star field.
+void initStars()
+{
+    starField.clear();
+    starField.reserve(numStars);
+    std::mt19937 gen(randomSeed);
+    std::uniform_real_distribution<float> distR(.2f, .3f);
+    std::uniform_real_distribution<float> distZ(0.f, 360.f);
+    std::uniform_real_distribution<float> distY(0.f, 360.f);
+    for(int i = 0; i < numStars; i++)
+    {
+        float radius = distR(gen);
+        float y = distY(gen);
+        float z = distZ(gen);
+        vm::vec3 position = vm::rotate_y(y) * (vm::rotate_z(z) * vm::vec3{starDistance, 0.f, 0.f});
+        float brightness = vm::map(radius, .2f, .3f, .6f, 1.f);
+        starField.add(position, {brightness, brightness, brightness, 1.f});
+    }
+}
+
+void initSolarSystem()
+{
+    // semi-major axes are scaled for display, eccentricities and arguments of periapsis are the real ones.
+    auto body = [](int parent, float radius, float distance, float tilt, 
+                   float orbitDuration, float orbitOffset, float eccentricity = 0.f, float periapsis = 0.f,
+                   vm::mat4 frame = vm::identity<float>())
+    {
+        vsim::Body b;
+        b.parent              = parent;
+        b.radius              = radius;
+        b.orbit.semiMajorAxis = distance;
+        b.orbit.eccentricity  = eccentricity;
+        b.orbit.inclination   = tilt;
+        b.orbit.periapsis     = periapsis;
+        b.orbit.meanAnomaly   = vm::norm2deg(orbitOffset);
+        b.orbit.period        = orbitDuration;
+        b.frame               = frame;
+        return b;
+    };
+    solarSystem.clear();
+    solarSystem.reserve(NUM_BODIES + numAsteroids);
+    solarSystem.add(body(vsim::NO_PARENT, .8f,  0.f,   0, 0, 0));
+    solarSystem.add(body(vsim::NO_PARENT, .34f, 3.f, -10, orbitDurationMercury, orbitOffsetMercury, .2056f, 29.1f));
+    solarSystem.add(body(vsim::NO_PARENT, .4f,  5.f,  30, orbitDurationVenus, orbitOffsetVenus, .0068f, 54.9f));
+    solarSystem.add(body(vsim::NO_PARENT, .45f, 7.f,   0, orbitDurationEarth, orbitOffsetEarth, .0167f, 114.2f));
+    solarSystem.add(body(EARTH,           .1f,  .8f,   0, orbitDurationEarthMoon, orbitOffsetEarthMoon, .0549f, 318.2f,
+                         vm::rotate_x(vm::deg2rad(90.f))));
+    solarSystem.add(body(vsim::NO_PARENT, .4f,  9.f,  20, orbitDurationMars, orbitOffsetMars, .0934f, 286.5f));
+    solarSystem.add(body(vsim::NO_PARENT, .8f, 11.f, -20, orbitDurationJupiter, orbitOffsetJupiter, .0489f, 273.9f));
+    solarSystem.add(body(vsim::NO_PARENT, .6f, 14.f,  15, orbitDurationSaturn, orbitOffsetSaturn, .0565f, 339.4f));
+    solarSystem.add(body(vsim::NO_PARENT, .4f, 17.f,  20, orbitDurationUranus, orbitOffsetUranus, .0457f, 96.9f));
+    solarSystem.add(body(vsim::NO_PARENT, .4f, 19.f,   0, orbitDurationNeptune, orbitOffsetNeptune, .0113f, 273.2f));
 
-void renderPlanet(char const * label, float radius, float distance
-                , Material material = {}, float tiltAngle = 0.f
-                , float orbitDuration = 0.f, float orbitOffset = 0.f
-                , void (*child)() = nullptr)
-{
-    vm::mat4 mPlanet = vm::identity<float>();
-    vm::mat4 mTilt   = vm::rotate_z(vm::deg2rad(tiltAngle));
-    vm::mat4 mPlace  = vm::translate(distance, 0.f, 0.f);
-    vm::mat4 mScale  = vm::scale(radius, radius, radius);
-    if(orbitDuration != 0.f) 
-    {
-        float orbitAngle = 360.f*(orbitOffset+elapsedTime*orbitDurationPerSec/orbitDuration);
-        vm::mat4 mOrbit = vm::rotate_y(vm::deg2rad(orbitAngle));
-        mPlanet = mTilt * mOrbit * mPlace;
-        // render trail
-        if(switchTrails)
+    // asteroid belt between mars and jupiter, periods from kepler's third law relative to earth.
+    {
+        std::mt19937 gen(randomSeed + 1);
+        std::uniform_real_distribution<float> distA(9.7f, 10.4f);
+        std::uniform_real_distribution<float> distE(0.f, .2f);
+        std::uniform_real_distribution<float> distI(-4.f, 4.f);
+        std::uniform_real_distribution<float> distAngle(0.f, 360.f);
+        std::uniform_real_distribution<float> distShade(.35f, .6f);
+        asteroidField.clear();
+        asteroidField.reserve(numAsteroids);
+        for(int i = 0; i < numAsteroids; i++)
         {
-            glPushAttrib(GL_ENABLE_BIT);
-            glDisable(GL_LIGHTING);
-            glPushMatrix();
-            glBegin(GL_LINE_STRIP);
-            for(int i = 0; i <= 10; i++) 
-            {
-                float inorm = float(i) / 10.f;
-                float lineColor[] = { 1.f, 1.f, 1.f, 1.f - inorm };
-                glColor4fv(lineColor);
-                float lineDist = 50;
-                float theta = inorm * lineDist;
-                vm::mat4 mPath = vm::rotate_y(-vm::deg2rad(theta));
-                vm::vec3 v = (mTilt * (mPath * (mOrbit * (mPlace * vm::vec3{}))));
-                glVertex3f(v.x, v.y, v.z);
-            }
-            glEnd();
-            glPopMatrix();
-	        glPopAttrib();
+            vsim::Body b;
+            b.radius              = .02f;
+            b.orbit.semiMajorAxis = distA(gen);
+            b.orbit.eccentricity  = distE(gen);
+            b.orbit.inclination   = distI(gen);
+            b.orbit.ascendingNode = distAngle(gen);
+            b.orbit.periapsis     = distAngle(gen);
+            b.orbit.meanAnomaly   = distAngle(gen);
+            b.orbit.period        = orbitDurationEarth * std::pow(b.orbit.semiMajorAxis / 7.f, 1.5f);
+            solarSystem.add(b);
+            float shade = distShade(gen);
+            asteroidField.add({}, {shade, shade*.95f, shade*.9f, 1.f});
         }
     }
-    else
-        mPlanet = mTilt * mPlace;
-    glColorMaterial(GL_FRONT, GL_AMBIENT_AND_DIFFUSE|GL_EMISSION);
-    glMaterialfv(GL_FRONT, GL_AMBIENT, material.ambient.ptr());
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, material.diffuse.ptr());
-    glMaterialfv(GL_FRONT, GL_SPECULAR, material.specular.ptr());
-    glMaterialfv(GL_FRONT, GL_EMISSION, material.emission.ptr());
-    glMaterialf(GL_FRONT, GL_SHININESS, material.specular.w);
-    static v3d::SolidSphere sphere(1.f, 28, 24);
-    glColor4fv(material.diffuse.ptr());
-    glPushMatrix();
-    glMultMatrixf(transpose(mPlanet).ptr());
+
+    // one full orbit per named body, sampled once. rendering only picks the window behind the body.
+    {
+        vm::soa3 loop(trailSamples);
+        trails.resize(NUM_BODIES);
+        for(int i = 0; i < NUM_BODIES; i++)
+        {
+            if(solarSystem.body(i).orbit.period == 0.f)
+                continue;
+            solarSystem.path(i, 0.f, 360.f * float(trailSamples - 1) / float(trailSamples), loop);
+            trails[i].set(loop, std::size_t(trailSpan / 360.f * float(trailSamples)) + 1);
+        }
+    }
+}
+
+// trail behind an orbiting body, drawn in its orbit plane from the sample at or just behind it.
+void renderBodyTrail(int body)
+{
+    if(!switchTrails || body >= int(trails.size()) || trails[body].size() == 0)
+        return;
+    // loop sample k sits at mean anomaly -k/trailSamples of a revolution.
+    long first = long(std::ceil(-solarSystem.meanAnomaly(body) / vm::TWOPI * float(trailSamples)));
+    first = (first % trailSamples + trailSamples) % trailSamples;
+    // bounded by the orbit: no point of the ellipse is further from the focus than the apoapsis.
+    vm::mat4 mOrbit = solarSystem.orbit(body, renderOrigin);
+    vsim::Elements const & orbit = solarSystem.body(body).orbit;
+    vm::vec3 focus = {mOrbit.row[0][3], mOrbit.row[1][3], mOrbit.row[2][3]};
+    if(!vm::frustum_test(viewFrustum, focus, orbit.semiMajorAxis * (1.f + orbit.eccentricity)))
+        return;
     glPushMatrix();
-    glMultMatrixf(transpose(mScale).ptr());
-    sphere.render();
+    glMultMatrixf(transpose(mOrbit).ptr());
+    trails[body].render(std::size_t(first));
     glPopMatrix();
+}
+
+// materials with alpha are blended, sorted back to front after everything opaque.
+void queueMesh(int mesh, int material, vm::mat4 const & mModel)
+{
+    bool const blended = renderQueue.material(material).diffuse.w < 1.f;
+    renderQueue.push(mesh, material, mModel, blended ? v3d::RenderQueue::BLEND_ALPHA : v3d::RenderQueue::BLEND_NONE);
+}
+
+// radius in pixels of a sphere around a point relative to the render origin, huge once the camera is inside.
+float pixelRadius(vm::vec3 const & center, float radius)
+{
+    float const depth = (mViewProjection * vm::vec4{center.x, center.y, center.z, 1.f}).w; // view space distance
+    float const r = radius * camScale;
+    if(depth <= r)
+        return std::numeric_limits<float>::max();
+    return r * mProjection.row[1][1] * .5f * float(windowHeight) / depth;
+}
+
+// render queue mesh of the sphere level for a body drawn at radius. layer tells apart spheres of one body.
+int sphereMesh(int body, int layer, float radius)
+{
+    int & level = sphereLevels[body][layer];
+    level = sphereLod.select(pixelRadius(solarSystem.position(body, renderOrigin), radius), level);
+    return sphereMeshes[level];
+}
+
+// radius 0 uses the radius from the body table. material is a render queue id.
+void renderPlanet(char const * label, int body, int material, float radius = 0.f, int layer = 0)
+{
+    if(radius == 0.f)
+        radius = solarSystem.body(body).radius;
+    vm::mat4 mScale = vm::scale(radius, radius, radius);
+    vm::mat4 mPlanet = solarSystem.transform(body, renderOrigin);
+    if(!vm::frustum_test(viewFrustum, solarSystem.position(body, renderOrigin), radius))
+        return;
+    queueMesh(sphereMesh(body, layer, radius), material, mPlanet * mScale);
     if(switchLabels && label != nullptr)
     {
         float textPosition[] = {radius, radius};
-        renderText(label, textPosition);
+        renderText(label, mPlanet, textPosition);
     }
-    if(child != nullptr)
-        child();
-    glPopMatrix();
 }
 
-void renderRingedPlanet(char const * label, float radius, float distance
-                      , float ringRadius = 0.f, float ringSize = 0.f
-                      , Material material = {}, Material ringMaterial = {}
-                      , float tiltAngle = 0.f, float orbitDuration = 0.f, float orbitOffset = 0.f)
+// rings come from the table, see initMeshes().
+void renderRingedPlanet(char const * label, int body, int material, int ringMaterial)
 {
-    vm::mat4 mPlanet = vm::identity<float>();
-    vm::mat4 mTilt   = vm::rotate_z(vm::deg2rad(tiltAngle));
-    vm::mat4 mPlace  = vm::translate(distance, 0.f, 0.f);
-    vm::mat4 mScale  = vm::scale(radius, radius, radius);
-    if(orbitDuration != 0.f) 
-    {
-        float orbitAngle = 360.f*(orbitOffset+elapsedTime*orbitDurationPerSec/orbitDuration);
-        vm::mat4 mOrbit = vm::rotate_y(vm::deg2rad(orbitAngle));
-        mPlanet = mTilt * mOrbit * mPlace * mScale;
-        // render trail
-        if(switchTrails)
-        {
-            glPushAttrib(GL_ENABLE_BIT);
-            glDisable(GL_LIGHTING);
-            glPushMatrix();
-            glBegin(GL_LINE_STRIP);
-            for(int i = 0; i <= 10; i++) 
-            {
-                float inorm = float(i) / 10.f;
-                float lineColor[] = { 1.f, 1.f, 1.f, 1.f - inorm };
-                glColor4fv(lineColor);
-                float lineDist = 50;
-                float theta = inorm * lineDist;
-                vm::mat4 mPath = vm::rotate_y(-vm::deg2rad(theta));
-                vm::vec3 v = (mTilt * (mPath * (mOrbit * (mPlace * vm::vec3{}))));
-                glVertex3f(v.x, v.y, v.z);
-            }
-            glEnd();
-            glPopMatrix();
-	        glPopAttrib();
-        }
-    }
-    else
-        mPlanet = mTilt * mPlace * mScale;
-    static v3d::SolidSphere sphere(1.f, 28, 24);
-    glColorMaterial(GL_FRONT, GL_AMBIENT_AND_DIFFUSE|GL_EMISSION);
-    glMaterialfv(GL_FRONT, GL_AMBIENT, material.ambient.ptr());
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, material.diffuse.ptr());
-    glMaterialfv(GL_FRONT, GL_SPECULAR, material.specular.ptr());
-    glMaterialfv(GL_FRONT, GL_EMISSION, material.emission.ptr());
-    glMaterialf(GL_FRONT, GL_SHININESS, material.specular.w);
-    glColor4fv(material.diffuse.ptr());
-    glPushMatrix();
-    glMultMatrixf(transpose(mPlanet).ptr());
-    glutSolidSphere(1.f, 28, 24);
-    sphere.render();
-    if(ringSize > 0.f)
-    {
-        glColorMaterial(GL_FRONT, GL_AMBIENT_AND_DIFFUSE|GL_EMISSION);
-        glMaterialfv(GL_FRONT, GL_AMBIENT, ringMaterial.ambient.ptr());
-        glMaterialfv(GL_FRONT, GL_DIFFUSE, ringMaterial.diffuse.ptr());
-        glMaterialfv(GL_FRONT, GL_SPECULAR, ringMaterial.specular.ptr());
-        glMaterialfv(GL_FRONT, GL_EMISSION, ringMaterial.emission.ptr());
-        glMaterialf(GL_FRONT, GL_SHININESS, ringMaterial.specular.w);
-        glColor4fv(ringMaterial.diffuse.ptr());
-        // glutSolidTorus(ringSize/radius, ringRadius/radius, 2, 45);
-        static v3d::SolidTorus torus(ringSize/radius, ringRadius/radius, 45, 2);
-        torus.render();
-    }
+    float radius = solarSystem.body(body).radius;
+    Ring const & ring = rings[body];
+    if(!vm::frustum_test(viewFrustum, solarSystem.position(body, renderOrigin), vm::max(radius, ring.radius + ring.size)))
+        return;
+    vm::mat4 mPlanet = solarSystem.transform(body, renderOrigin) * vm::scale(radius, radius, radius);
+    queueMesh(sphereMesh(body, 0, radius), material, mPlanet);
+    if(ring.mesh >= 0)
+        queueMesh(ring.mesh, ringMaterial, mPlanet);
     if(switchLabels && label != nullptr)
     {
         float textPosition[] = {radius, radius};
-        renderText(label, textPosition);
+        renderText(label, mPlanet, textPosition);
     }
-    glPopMatrix();
 }
 
-void renderStar(float radius, float yzProjections[2], float color[4]) {
-    vm::mat4 mStar = 
-          vm::rotate_y<float>(yzProjections[0]) 
-        * vm::rotate_z<float>(yzProjections[1]) 
-        * vm::translate<float>(starDistance, 0, 0)
-        * vm::scale(radius, radius, radius);
-    glColor4fv(color);
-    glColorMaterial(GL_FRONT, GL_EMISSION);
-    glMaterialfv(GL_FRONT, GL_EMISSION, color);
+void renderBackground() 
+{
+    vm::mat4 mOrigin = vm::translate(float(-renderOrigin.x), float(-renderOrigin.y), float(-renderOrigin.z));
     glPushMatrix();
-    glMultMatrixf(transpose(mStar).ptr());
-    static v3d::SolidSphere sphere(1.f, 4, 4);
-    sphere.render();
+    glMultMatrixf(transpose(mOrigin).ptr());
+    vm::frustum_planes starFrustum = vm::make_frustum(mViewProjection * mOrigin);
+    starField.render(&starFrustum);
     glPopMatrix();
 }
 
-void renderBackground() 
+void renderAsteroids()
 {
-    for(size_t i = 0; i < starGens.size(); i++) 
+    asteroidPositions.resize(std::size_t(numAsteroids));
+    for(int i = 0; i < numAsteroids; i++)
     {
-        vm::vec3 const & starGen = starGens[i];
-        float color[4] = {1.f,1.f,1.f,1.f};
-        float yzProjections[2] = { starGen.y, starGen.z };
-        renderStar(starGen.x, yzProjections, color);
+        vm::vec3 const position = solarSystem.position(NUM_BODIES + i, renderOrigin);
+        asteroidPositions.set(std::size_t(i), position);
+        asteroidField.setPosition(i, position);
+    }
+    asteroidField.render();
+    if(switchLabels && labelAsteroids)
+    {
+        asteroidVisible.resize(std::size_t(numAsteroids));
+        vm::frustum_test(viewFrustum, asteroidPositions.span(), nullptr, asteroidVisible.data());
+        char label[16];
+        float textPosition[] = {0.f, 0.f};
+        for(int i = 0; i < numAsteroids; i++)
+        {
+            if(!asteroidVisible[std::size_t(i)])
+                continue;
+            snprintf(label, sizeof(label), "A%d", i + 1);
+            renderText(label, solarSystem.transform(NUM_BODIES + i, renderOrigin), textPosition);
+        }
     }
 }
 
 void renderSun() 
 {
-    static Material material = {{1.f, 0.6f, 0.3f, 1.f}, {1.f, 0.6f, 0.3f, 1.f}};
-    static Material haloMaterial = {{1.f, 0.77f, 0.6f, .1f}, {1.f, 0.77f, 0.6f, 1.f}};
-    renderPlanet("Sun", .8f, 0.f, material, 0, 0);
-    float r1 = vm::map<float>(std::sin(vm::norm2rad(1.f/2.f)*elapsedTime+0.0f), -1, 1, 1.1f, 1.3f);
-    float r2 = vm::map<float>(std::sin(vm::norm2rad(1.f/2.f)*elapsedTime+0.03f), -1, 1, 1.3f, 1.5f);
-    float r3 = vm::map<float>(std::sin(vm::norm2rad(1.f/2.f)*elapsedTime+0.07f), -1, 1, 1.4f, 1.7f);
-    renderPlanet(nullptr, r1, 0.f, haloMaterial, 0, 0);
-    renderPlanet(nullptr, r2, 0.f, haloMaterial, 0, 0);
-    renderPlanet(nullptr, r3, 0.f, haloMaterial, 0, 0);
+    static int const material = renderQueue.addMaterial({{1.f, 0.6f, 0.3f, 1.f}, {1.f, 0.6f, 0.3f, 1.f}});
+    static int const haloMaterial = renderQueue.addMaterial({{1.f, 0.77f, 0.6f, .1f}, {1.f, 0.77f, 0.6f, 1.f}});
+    renderPlanet("Sun", SUN, material);
+    float pulse = float(std::fmod(elapsedTime, 2.0)); // one pulse every 2 seconds
+    float r1 = vm::map<float>(std::sin(vm::norm2rad(1.f/2.f)*pulse+0.0f), -1, 1, 1.1f, 1.3f);
+    float r2 = vm::map<float>(std::sin(vm::norm2rad(1.f/2.f)*pulse+0.03f), -1, 1, 1.3f, 1.5f);
+    float r3 = vm::map<float>(std::sin(vm::norm2rad(1.f/2.f)*pulse+0.07f), -1, 1, 1.4f, 1.7f);
+    renderPlanet(nullptr, SUN, haloMaterial, r1, 1);
+    renderPlanet(nullptr, SUN, haloMaterial, r2, 2);
+    renderPlanet(nullptr, SUN, haloMaterial, r3, 3);
 }
 
 void renderMercury() 
 {
-    static Material material = { {0.48f, 0.25f, 0.09f, 1.f} };
-    renderPlanet("Mercury", .34f, 3.f, material, -10, orbitDurationMercury, orbitOffsetMercury);
+    static int const material = renderQueue.addMaterial({ {0.48f, 0.25f, 0.09f, 1.f} });
+    renderPlanet("Mercury", MERCURY, material);
 }
 
 void renderVenus() 
 {
-    static Material material = { {.84f, 0.67f, 0.55f, 1.f} };
-    renderPlanet("Venus", .4f, 5.f, material, 30, orbitDurationVenus, orbitOffsetVenus);
+    static int const material = renderQueue.addMaterial({ {.84f, 0.67f, 0.55f, 1.f} });
+    renderPlanet("Venus", VENUS, material);
 }
 
 void renderEarth() 
 {
-    static Material material = { {0.19f, 0.78f, 0.95f, 1.f} };
-    renderPlanet("Earth", .45f, 7.f, material, 0, orbitDurationEarth, orbitOffsetEarth,
-    []() 
-    {
-        glPushMatrix();
-        glRotatef(90.f, 1.f, 0.f, 0.f);
-        static Material moonMaterial = { {0.9f, 0.9f, 0.9f, 1.f} };
-        renderPlanet("Moon", .1f, .8f, moonMaterial, 0, orbitDurationEarthMoon, orbitOffsetEarthMoon);
-        glPopMatrix();
-    });
+    static int const material = renderQueue.addMaterial({ {0.19f, 0.78f, 0.95f, 1.f} });
+    static int const moonMaterial = renderQueue.addMaterial({ {0.9f, 0.9f, 0.9f, 1.f} });
+    renderPlanet("Earth", EARTH, material);
+    renderPlanet("Moon", MOON, moonMaterial);
 }
 
 void renderMars() 
 {
-    static Material material = { {.83f, 0.24f, 0.16f, 1.f} };
-    renderPlanet("Mars", .4f, 9.f, material, 20, orbitDurationMars, orbitOffsetMars);
+    static int const material = renderQueue.addMaterial({ {.83f, 0.24f, 0.16f, 1.f} });
+    renderPlanet("Mars", MARS, material);
 }
 
 void renderJupiter() 
 {
-    static Material material = { {.6f, 0.26f, 0.12f, 1.f} };
-    renderPlanet("Jupiter", .8f, 11.f, material, -20, orbitDurationJupiter, orbitOffsetJupiter);
+    static int const material = renderQueue.addMaterial({ {.6f, 0.26f, 0.12f, 1.f} });
+    renderPlanet("Jupiter", JUPITER, material);
 }
 
+// shared by both rings.
+static int const ringMaterial = renderQueue.addMaterial({ {.97f, 0.88f, 0.81f, .5f} });
+
 void renderSaturn()  
 {
-    static Material material = { {.96f, 0.95f, 0.70f, 1.f} };
-    static Material ringMaterial = { {.97f, 0.88f, 0.81f, .5f} };
-    renderRingedPlanet("Saturn", .6f, 14.f, .9f, .14f, material, ringMaterial, 
-        15, orbitDurationSaturn, orbitOffsetSaturn);
+    static int const material = renderQueue.addMaterial({ {.96f, 0.95f, 0.70f, 1.f} });
+    renderRingedPlanet("Saturn", SATURN, material, ringMaterial);
 }
 
 void renderUranus() 
 {
-    static Material material = { {.46f, 0.82f, 0.70f, 1.f} };
-    static Material ringMaterial = { {.97f, 0.88f, 0.81f, .5f} };
-    renderRingedPlanet("Uranus", .4f, 17.f, .7f, .05f, material, ringMaterial, 
-        20, orbitDurationUranus, orbitOffsetUranus);
+    static int const material = renderQueue.addMaterial({ {.46f, 0.82f, 0.70f, 1.f} });
+    renderRingedPlanet("Uranus", URANUS, material, ringMaterial);
 }
 
 void renderNeptune()  
 {
-    static Material material = { {.0f, 0.65f, 0.88f, 1.f} };
-    renderPlanet("Neptune", .4f, 19.f, material, 0, orbitDurationNeptune, orbitOffsetNeptune);
+    static int const material = renderQueue.addMaterial({ {.0f, 0.65f, 0.88f, 1.f} });
+    renderPlanet("Neptune", NEPTUNE, material);
 }
 
 void renderSolarSystem() 
 {
     glPushMatrix();
-    renderMercury();
-    renderVenus();
-    renderEarth();
-    renderMars();
-    renderJupiter();
-    renderSaturn();
-    renderUranus();
-    renderNeptune();
-    renderSun();
+    {
+        vprof::Scope scope(profiler, stageTrails);
+        for(int body = 0; body < NUM_BODIES; body++)
+            renderBodyTrail(body);
+    }
+    { vprof::Scope scope(profiler, stageAsteroids); renderAsteroids(); }
+    {
+        vprof::Scope scope(profiler, stageBodies);
+        renderQueue.begin(mCamera);
+        renderMercury();
+        renderVenus();
+        renderEarth();
+        renderMars();
+        renderJupiter();
+        renderSaturn();
+        renderUranus();
+        renderNeptune();
+        renderSun();
+    }
+    { vprof::Scope scope(profiler, stageSubmit); renderQueue.submit(); }
     glPopMatrix();
 }
 
-void renderText(char const * text, float position[2])
+// queues a label at a point in the model frame. all text is drawn in one batch at the end of the frame.
+void renderText(char const * text, vm::mat4 const & mModel, float position[2])
 {
-	char const * ch;
-
-	glPushAttrib(GL_ENABLE_BIT);
-	glDisable(GL_LIGHTING);
-	glDisable(GL_DEPTH_TEST);
-
-	glPushMatrix();
-    glColor3f(0.1f, 0.1f, 0.1f);
-    glRasterPos2f(position[0]+.01f, position[1]-.01f);
-    ch = &text[0];
-    while(*ch) {
-        glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *ch++);
-    }
-    glColor3f(1.f, 0.f, 0.4f);
-    glRasterPos2f(position[0], position[1]);
-    ch = &text[0];
-    while(*ch) {
-        glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *ch++);
-    }
-	glPopMatrix();
-	glPopAttrib();
+    vm::vec4 clip = mViewProjection * (mModel * vm::vec4{position[0], position[1], 0.f, 1.f});
+    // same rule as glRasterPos, labels whose anchor is clipped are not drawn.
+    if(clip.w <= 0.f || std::fabs(clip.x) > clip.w || std::fabs(clip.y) > clip.w || std::fabs(clip.z) > clip.w)
+        return;
+    float x = (clip.x / clip.w * .5f + .5f) * float(windowWidth);
+    float y = (clip.y / clip.w * .5f + .5f) * float(windowHeight);
+    ::text.add(x + 1.f, y - 1.f, text, {0.1f, 0.1f, 0.1f, 1.f});
+    ::text.add(x, y, text, {1.f, 0.f, 0.4f, 1.f});
 }
 
 void idle()
@@ -463,38 +884,82 @@ void idle()
 
 void display()
 {
-    float currentTime = glutGet(GLUT_ELAPSED_TIME) / 1000.f;
-    deltaTime = currentTime - lastTime;
+    // the time since the last frame went to glut, dispatching input and the idle callback.
+    static vprof::clock::time_point eventsStart;
+    if(!headless && eventsStart != vprof::clock::time_point{} && profiler.isActive())
+        profiler.add(stageEvents, eventsStart, vprof::clock::now());
+    {
+        vprof::Scope scope(profiler, stageFrame);
+        renderFrame();
+    }
+    profiler.endFrame();
+    eventsStart = vprof::clock::now();
+}
+
+void renderFrame()
+{
+    double currentTime = currentSeconds();
+    deltaTime = float(currentTime - lastTime);
     lastTime = currentTime;
+    if(capturePath != nullptr && !recorder.isRecording() && recorder.getFrameCount() == 0)
+    {
+        if(!recorder.open(capturePath, windowWidth, windowHeight))
+        {
+            std::fprintf(stderr, "capture: could not open %s\n", capturePath);
+            capturePath = nullptr;
+        }
+    }
+    if(recorder.isRecording())
+        deltaTime = 1.f / captureFps;
+    else if(fixedDeltaTime > 0.f)
+        deltaTime = fixedDeltaTime;
     if(switchAnimation)
-        elapsedTime += deltaTime;
+        elapsedTime += double(deltaTime) * timeWarp;
     if(switchAnimation && switchRotate)
         camTheta += 3.f * deltaTime;
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glMatrixMode(GL_MODELVIEW);
     vm::mat4 mCameraScale  = vm::scale(camScale, camScale, camScale);
-    vm::mat4 mCameraPan    = vm::translate(camPan[0], camPan[1], camPan[2]);
     vm::mat4 mCameraOrbitY = vm::rotate_y(vm::deg2rad(camTheta));
     vm::mat4 mCameraTiltX  = vm::rotate_x(vm::deg2rad(camPhi));
     vm::mat4 mCameraZoom  = vm::translate(0.f, 0.f, -camDist);
-    vm::mat4 mCamera = mCameraZoom * mCameraTiltX * mCameraOrbitY * mCameraPan * mCameraScale;
+    mCamera = mCameraZoom * mCameraTiltX * mCameraOrbitY * mCameraScale;
     glLoadMatrixf(vm::transpose(mCamera).ptr());
+    mViewProjection = mProjection * mCamera;
+    viewFrustum = vm::make_frustum(mViewProjection);
+    // the pan moves the render origin instead of the camera, positions are made relative to it in double.
+    renderOrigin = vm::vec3d{-camPan[0], -camPan[1], -camPan[2]} / double(camScale);
 
-	float lightPosition[] = {0.f, 0.f, 0.f, 1.f};
+	float lightPosition[] = {float(-renderOrigin.x), float(-renderOrigin.y), float(-renderOrigin.z), 1.f};
     glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+    if(renderQueue.getShader() != nullptr)
+        litShader.setFrame(mProjection, mCamera * vm::vec4{lightPosition[0], lightPosition[1], lightPosition[2], 1.f}, sunLight);
     
+    {
+        vprof::Scope scope(profiler, stageSimulation);
+        solarSystem.evaluate(elapsedTime);
+    }
+
     glPushMatrix();
-        renderBackground();
+        { vprof::Scope scope(profiler, stageBackground); renderBackground(); }
         renderSolarSystem();
-        printHelp();
-        printFps();
+        { vprof::Scope scope(profiler, stageHud); printHelp(); printFps(); printProfile(); }
     glPopMatrix();
+    { vprof::Scope scope(profiler, stageText); text.render(windowWidth, windowHeight); }
 
-	glutSwapBuffers();
+    if(recorder.isRecording())
+    {
+        vprof::Scope scope(profiler, stageCapture);
+        recorder.capture();
+        if(recorder.getFrameCount() >= numFrames || recorder.hasFailed())
+            finishCapture();
+    }
+
+    { vprof::Scope scope(profiler, stageSwap); swapBuffers(); }
     // calculate FPS
     {
         nFrames++;
-        float frameTime = currentTime - lastFrameTime;
+        float frameTime = float(currentTime - lastFrameTime);
         if(frameTime > 1.f) {
             fps = float(nFrames) / frameTime;
             nFrames = 0;
@@ -510,7 +975,7 @@ void reshape(int x, int y)
 	windowWidth = x;
 	windowHeight = y;
     // vm::mat4 mProjection = vm::ortho<float>(-aspect, aspect, -1, 1, znear, 500.0);
-    vm::mat4 mProjection = vm::fov<float>(50.f, aspect, znear, 500.0);
+    mProjection = vm::fov<float>(50.f, aspect, znear, 500.0);
 	glViewport(0, 0, x, y);
 	glMatrixMode(GL_PROJECTION);
     // gluPerspective(50, aspect, znear, 500);
@@ -587,13 +1052,29 @@ void keyPress(unsigned char key, int x, int y)
 	case 'r':
 		switchRotate ^= 1;
 		break;
+	case 'p':
+		profiler.setEnabled(!profiler.isEnabled());
+		break;
+	case 'j':
+		if(trace.isRecording())
+			writeTrace();
+		else
+			trace.start();
+		break;
+	case '+':
+	case '=':
+		timeWarp = vm::min(timeWarp * 2.f, 4096.f);
+		break;
+	case '-':
+		timeWarp = vm::max(timeWarp / 2.f, 1.f / 64.f);
+		break;
 	case ' ':
 		switchAnimation ^= 1;
 		glutIdleFunc(switchAnimation ? idle : 0);
 		glutPostRedisplay();
 		if(switchAnimation)
         {
-            lastTime = glutGet(GLUT_ELAPSED_TIME) / 1000.f;
+            lastTime = currentSeconds();
             lastFrameTime = lastTime;
             nFrames = 0;
         }
@@ -630,74 +1111,86 @@ void sKeyPress(int key, int x, int y)
 
 void printHelp()
 {
-	int i;
-	char const *s, **text;
-
-	glPushAttrib(GL_ENABLE_BIT);
-	glDisable(GL_LIGHTING);
-	glDisable(GL_DEPTH_TEST);
-
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	glMatrixMode(GL_PROJECTION);
-	glPushMatrix();
-	glLoadIdentity();
-	glOrtho(0, windowWidth, 0, windowHeight, -1, 1);
-
-	text = switchHelp ? helpText : helpPrompt;
-
-	for(i=0; text[i]; i++) {
-		glColor3f(0.f, 0.1f, 0.f);
-		glRasterPos2f(7.f, float(windowHeight - (i + 1) * 20 - 2));
-		s = text[i];
-		while(*s) {
-			glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *s++);
-		}
-		glColor3f(0.f, 0.9f, 0.f);
-		glRasterPos2f(5.f, float(windowHeight - (i + 1) * 20));
-		s = text[i];
-		while(*s) {
-			glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *s++);
-		}
+	if(recorder.isRecording())
+		return;
+	char const **lines = switchHelp ? helpText : helpPrompt;
+	for(int i = 0; lines[i]; i++) {
+		float y = float(windowHeight - (i + 1) * 20);
+		text.add(7.f, y - 2.f, lines[i], {0.f, 0.1f, 0.f, 1.f});
+		text.add(5.f, y, lines[i], {0.f, 0.9f, 0.f, 1.f});
 	}
-
-	glPopMatrix();
-	glMatrixMode(GL_MODELVIEW);
-
-	glPopAttrib();
 }
  
 void printFps()
 {
-    if(switchAnimation) {
-	    char const *s, *text;
+    if(switchAnimation && !recorder.isRecording()) {
         char buffer[128] = {};
         snprintf(buffer, sizeof(buffer), "%4.0f FPS", fps);
-        text = buffer;
-        glPushAttrib(GL_ENABLE_BIT);
-        glDisable(GL_LIGHTING);
-        glDisable(GL_DEPTH_TEST);
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-        glMatrixMode(GL_PROJECTION);
-        glPushMatrix();
-        glLoadIdentity();
-        glOrtho(0, windowWidth, 0, windowHeight, -1, 1);
-        glColor3f(0.f, 0.1f, 0.f);
-        glRasterPos2f(7.f, 20 );
-        s = text;
-        while(*s) {
-            glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *s++);
+        text.add(7.f, 20.f, buffer, {0.f, 0.1f, 0.f, 1.f});
+        text.add(5.f, 22.f, buffer, {0.9f, 0.9f, 0.f, 1.f});
+    }
+
+}
+
+// stage timings in ms over the profiler window, top right.
+void printProfile()
+{
+    if(!profiler.isEnabled() || recorder.isRecording())
+        return;
+    char line[128];
+    float const x = float(windowWidth - 50 * text.getCellWidth() - 5);
+    float y = float(windowHeight - 20);
+    snprintf(line, sizeof(line), "%-11s %-18s %s", "ms", "cpu min/avg/p99", profiler.hasGpuTimers() ? "gpu min/avg/p99" : "");
+    text.add(x + 2.f, y - 2.f, line, {0.f, 0.1f, 0.f, 1.f});
+    text.add(x, y, line, {0.9f, 0.9f, 0.f, 1.f});
+    for(int i = 0; i < int(profiler.size()); i++)
+    {
+        if(profiler.cpu(i).size() == 0)
+            continue;
+        y -= 16.f;
+        vprof::Histogram::Stats c = profiler.cpu(i).stats();
+        int n = snprintf(line, sizeof(line), "%-11s %5.2f %5.2f %5.2f ", profiler.name(i), c.min, c.avg, c.p99);
+        if(profiler.isGpuTimed(i) && n > 0)
+        {
+            vprof::Histogram::Stats g = profiler.gpu(i).stats();
+            snprintf(line + n, sizeof(line) - n, "  %5.2f %5.2f %5.2f", g.min, g.avg, g.p99);
         }
-        glColor3f(0.9f, 0.9f, 0.f);
-        glRasterPos2f(5.f, 20+2);
-        s = text;
-        while(*s) {
-            glutBitmapCharacter(GLUT_BITMAP_9_BY_15, *s++);
+        text.add(x + 2.f, y - 2.f, line, {0.f, 0.1f, 0.f, 1.f});
+        text.add(x, y, line, {0.f, 0.9f, 0.f, 1.f});
+    }
+}
+
+void reportProfile(FILE * out)
+{
+    std::fprintf(out, "%-11s %8s %8s %8s %8s %8s %8s\n", "stage", "cpu min", "cpu avg", "cpu p99", "gpu min", "gpu avg", "gpu p99");
+    for(int i = 0; i < int(profiler.size()); i++)
+    {
+        if(profiler.cpu(i).size() == 0)
+            continue;
+        vprof::Histogram::Stats c = profiler.cpu(i).stats();
+        std::fprintf(out, "%-11s %8.3f %8.3f %8.3f", profiler.name(i), c.min, c.avg, c.p99);
+        if(profiler.isGpuTimed(i))
+        {
+            vprof::Histogram::Stats g = profiler.gpu(i).stats();
+            std::fprintf(out, " %8.3f %8.3f %8.3f", g.min, g.avg, g.p99);
         }
-        glPopMatrix();
-        glMatrixMode(GL_MODELVIEW);
-        glPopAttrib();
+        std::fprintf(out, "\n");
     }
+}
 
+// stops a running trace and writes it out.
+void writeTrace()
+{
+    if(!trace.isRecording())
+        return;
+    trace.stop();
+    if(!trace.write(tracePath, "solar_system"))
+    {
+        std::fprintf(stderr, "trace: could not write %s\n", tracePath);
+        return;
+    }
+    std::printf("trace: %zu events written to %s", trace.size(), tracePath);
+    if(trace.getDropped() > 0)
+        std::printf(", %zu dropped, buffer full", trace.getDropped());
+    std::printf("\n");
 }
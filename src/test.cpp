@@ -6,7 +6,7 @@
 #include <random> 
 #include <vector>
 #include <iostream>
-#include <GL/glut.h>
+#include <GL/freeglut.h>
 #include <vmath>
 #include <v3d>
 
@@ -35,6 +35,7 @@ void motion(int x, int y);
 void printHelp();
 void printFps();
 void render();
+void updateMeshes();
 
 void renderText(char const * text, float position[2]);
 
@@ -46,6 +47,10 @@ float fps     = 0.f;
 long  nFrames = 0;
 
 unsigned int slices = 7, stacks = 6;
+// the meshes for the current slices and stacks. earlier ones stay cached, so stepping back is free.
+v3d::MeshRegistry meshes;
+v3d::MeshRegistry::Handle sphereMesh;
+v3d::MeshRegistry::Handle torusMesh;
 
 int windowWidth   = 0;
 int windowHeight  = 0;
@@ -83,6 +88,8 @@ int main(int argc, char *argv[])
 	glutMouseFunc(mouse);
 	glutMotionFunc(motion);
 
+    v3d::gl::load(glutGetProcAddress);
+
     glEnable(GL_LINE_SMOOTH);
     glEnable(GL_POLYGON_SMOOTH);
 	glEnable(GL_DEPTH_TEST);
@@ -111,6 +118,8 @@ int main(int argc, char *argv[])
         glLightfv(GL_LIGHT0, GL_SPECULAR, lightSpecular);
     }
 
+    updateMeshes();
+
     // for animation
     {
         lastTime = glutGet(GLUT_ELAPSED_TIME) / 1000.f;
@@ -135,28 +144,31 @@ void render()
     glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, specular);
 	glColor4fv(diffuse);
 	// glTranslatef(1.f, 0.f, 0.f);
-    static v3d::SolidSphere sphere(.4f, slices, stacks);
-	if(sphere.getSlices() != slices || sphere.getStacks() != stacks)
-	{
-		try { sphere = v3d::SolidSphere(.4f, slices, stacks); }
-		catch(std::exception e) { std::cerr << e.what() << std::endl; }
-
-	}
-    sphere.render(switchWireFrame, switchNormals);
+    if(v3d::SolidSphere * sphere = meshes.get<v3d::SolidSphere>(sphereMesh))
+        sphere->render(switchWireFrame, switchNormals);
     glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
     glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, ambient);
     glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, diffuse);
     glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, specular);
 	glColor4fv(diffuse);
-    static v3d::SolidTorus torus(.4f, 3.f, slices, stacks);
-	if(torus.getSlices() != slices || torus.getStacks() != stacks)
-	{
-		try { torus = v3d::SolidTorus(.4f, 3.f, slices, stacks); }
-		catch(std::exception e) { std::cerr << e.what() << std::endl; }
+    if(v3d::SolidTorus * torus = meshes.get<v3d::SolidTorus>(torusMesh))
+        torus->render(switchWireFrame, switchNormals);
+    glPopMatrix();
+}
 
+// swaps in the meshes for the current slices and stacks, outside of the frame.
+void updateMeshes()
+{
+    meshes.release(sphereMesh);
+    meshes.release(torusMesh);
+	try
+	{
+		sphereMesh = meshes.sphere(.4f, slices, stacks);
+		torusMesh  = meshes.torus(.4f, 3.f, slices, stacks);
 	}
-    torus.render(switchWireFrame, switchNormals);
-    glPopMatrix();
+	catch(std::exception const & e) { std::cerr << e.what() << std::endl; }
+    meshes.evict(16);
+    meshes.upload();
 }
 
 void renderText(char const * text, float position[2])
@@ -366,6 +378,7 @@ void sKeyPress(int key, int x, int y)
 		else
 			stacks = vm::max(stacks+1,2u);
 		printf("slices: %3u\t stacks: %3u\n", slices, stacks);
+		updateMeshes();
 		break;
 	case GLUT_KEY_DOWN:
 		if(switchSlicesStacks == 0)
@@ -373,6 +386,7 @@ void sKeyPress(int key, int x, int y)
 		else
 			stacks = vm::max(stacks-1,2u);
 		printf("slices: %3u\t stacks: %3u\n", slices, stacks);
+		updateMeshes();
 		break;
 	default:
 		break;
@@ -0,0 +1,293 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <new>
+#include <random>
+#include <vector>
+#include <vmath>
+#include <v3d>
+
+// micro benchmarks for the vmath operations and v3d meshes the renderer leans on.
+// usage: vmath_bench [--filter text] [--time ms]
+// prints ns per operation and heap allocations per operation, one line per case, then the vertex
+// cache miss ratios of the generated meshes.
+
+typedef std::chrono::steady_clock benchClock;
+
+/* allocation counting, every operator new in the process goes through here. the replacements
+   allocate and free through one pair of helpers, aligned or not, so they match each other. */
+
+std::size_t allocCount = 0;
+std::size_t allocBytes = 0;
+
+void * countedAlloc(std::size_t size, std::size_t alignment)
+{
+    allocCount++;
+    allocBytes += size;
+    size = size > 0 ? size : 1;
+#if defined(_MSC_VER)
+    void * p = _aligned_malloc(size, alignment);
+#elif defined(__cpp_aligned_new)
+    // aligned_alloc wants a multiple of the alignment, and at least the size of a pointer.
+    alignment = alignment < sizeof(void *) ? sizeof(void *) : alignment;
+    void * p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#else
+    (void)alignment; // before C++17 nothing asks for more than malloc gives
+    void * p = std::malloc(size);
+#endif
+    if(p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void countedFree(void * p) noexcept
+{
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void * operator new(std::size_t size) { return countedAlloc(size, alignof(std::max_align_t)); }
+void * operator new[](std::size_t size) { return countedAlloc(size, alignof(std::max_align_t)); }
+void operator delete(void * p) noexcept { countedFree(p); }
+void operator delete[](void * p) noexcept { countedFree(p); }
+void operator delete(void * p, std::size_t) noexcept { countedFree(p); }
+void operator delete[](void * p, std::size_t) noexcept { countedFree(p); }
+#ifdef __cpp_aligned_new
+// over-aligned types, e.g. vm::mat4 with VMATH_MAT4_ALIGN, in containers.
+void * operator new(std::size_t size, std::align_val_t alignment) { return countedAlloc(size, std::size_t(alignment)); }
+void * operator new[](std::size_t size, std::align_val_t alignment) { return countedAlloc(size, std::size_t(alignment)); }
+void operator delete(void * p, std::align_val_t) noexcept { countedFree(p); }
+void operator delete[](void * p, std::align_val_t) noexcept { countedFree(p); }
+void operator delete(void * p, std::size_t, std::align_val_t) noexcept { countedFree(p); }
+void operator delete[](void * p, std::size_t, std::align_val_t) noexcept { countedFree(p); }
+#endif
+
+/* keeps results alive so the optimizer can not drop the work */
+
+template <typename T>
+inline void keep(T const & value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r"(&value) : "memory");
+#else
+    static volatile char sink;
+    sink = *reinterpret_cast<char const volatile *>(&value);
+#endif
+}
+
+char const * filter = nullptr;
+double minTime = 200.0; // ms per case
+
+// runs body(i) in growing batches until minTime has passed, then reports the per call cost.
+template <typename F>
+void bench(char const * name, F body)
+{
+    if(filter != nullptr && std::strstr(name, filter) == nullptr)
+        return;
+    for(std::size_t i = 0; i < 16; i++) // warm up caches and branch predictors
+        body(i);
+    std::size_t iterations = 1;
+    double elapsed = 0.0;
+    std::size_t allocs = 0, bytes = 0;
+    for(;;)
+    {
+        std::size_t const allocs0 = allocCount, bytes0 = allocBytes;
+        benchClock::time_point const start = benchClock::now();
+        for(std::size_t i = 0; i < iterations; i++)
+            body(i);
+        elapsed = std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+        allocs = allocCount - allocs0;
+        bytes  = allocBytes - bytes0;
+        if(elapsed >= minTime || iterations >= (std::size_t(1) << 40))
+            break;
+        // aim a little past the target so the last batch usually finishes the case.
+        double const scale = elapsed > 0.0 ? minTime * 1.2 / elapsed : 100.0;
+        iterations = std::size_t(double(iterations) * vm::min(vm::max(scale, 2.0), 100.0));
+    }
+    double const n = double(iterations);
+    std::printf("%-32s %12.2f ns/op %10.2f allocs/op %12.1f B/op %12zu iterations\n"
+               , name, elapsed * 1e6 / n, double(allocs) / n, double(bytes) / n, iterations);
+}
+
+// post transform cache behaviour of a mesh's triangle order, for fifo caches of 16 and 32 entries.
+template <typename M>
+void cacheStats(char const * name, M const & mesh)
+{
+    if(filter != nullptr && std::strstr(name, filter) == nullptr)
+        return;
+    std::size_t const vertexCount = mesh.getVertices().size();
+    v3d::VertexCacheStats const fifo16 = v3d::vertexCacheStats(mesh.getIndices(), vertexCount, 16);
+    v3d::VertexCacheStats const fifo32 = v3d::vertexCacheStats(mesh.getIndices(), vertexCount, 32);
+    std::printf("%-32s %12.3f acmr16 %10.3f acmr32 %12.3f atvr16 %12zu vertices\n"
+               , name, fifo16.acmr, fifo32.acmr, fifo16.atvr, vertexCount);
+}
+
+/***********************************************************/
+
+int main(int argc, char *argv[])
+{
+    for(int i = 1; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else if(std::strcmp(argv[i], "--time") == 0 && i + 1 < argc)
+            minTime = vm::max(std::atof(argv[++i]), 1.0);
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--filter text] [--time ms]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // inputs come from tables, so no case folds into a constant. the masks keep indices in range.
+    std::size_t const N = 256, MASK = N - 1;
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+    std::vector<vm::mat4> matrices(N);
+    std::vector<vm::vec3> vectors3(N);
+    std::vector<vm::vec4> vectors4(N);
+    std::vector<float>    angles(N);
+    for(std::size_t i = 0; i < N; i++)
+    {
+        for(int r = 0; r < 4; r++)
+            for(int c = 0; c < 4; c++)
+                matrices[i].row[r][c] = dist(gen);
+        vectors3[i] = {dist(gen), dist(gen), dist(gen)};
+        vectors4[i] = {dist(gen), dist(gen), dist(gen), dist(gen)};
+        angles[i]   = dist(gen) * 3.14159265f;
+    }
+
+    std::printf("vmath_bench, %.0f ms per case\n", minTime);
+
+    /* vmath */
+
+    bench("mat4 * mat4", [&](std::size_t i) {
+        vm::mat4 r = matrices[i & MASK] * matrices[(i + 1) & MASK];
+        keep(r);
+    });
+    bench("mat4 * mat4 * mat4 * mat4", [&](std::size_t i) {
+        vm::mat4 r = matrices[i & MASK] * matrices[(i + 1) & MASK] * matrices[(i + 2) & MASK] * matrices[(i + 3) & MASK];
+        keep(r);
+    });
+    bench("mat4 * vec4", [&](std::size_t i) {
+        vm::vec4 r = matrices[i & MASK] * vectors4[(i + 1) & MASK];
+        keep(r);
+    });
+    bench("mat4 * vec3", [&](std::size_t i) {
+        vm::vec3 r = matrices[i & MASK] * vectors3[(i + 1) & MASK];
+        keep(r);
+    });
+    bench("rotate_x", [&](std::size_t i) {
+        vm::mat4 r = vm::rotate_x(angles[i & MASK]);
+        keep(r);
+    });
+    bench("rotate_y", [&](std::size_t i) {
+        vm::mat4 r = vm::rotate_y(angles[i & MASK]);
+        keep(r);
+    });
+    bench("rotate_z", [&](std::size_t i) {
+        vm::mat4 r = vm::rotate_z(angles[i & MASK]);
+        keep(r);
+    });
+    bench("transpose", [&](std::size_t i) {
+        vm::mat4 r = vm::transpose(matrices[i & MASK]);
+        keep(r);
+    });
+    bench("normal vec3", [&](std::size_t i) {
+        vm::vec3 r = vm::normal(vectors3[i & MASK]);
+        keep(r);
+    });
+    bench("normal vec4", [&](std::size_t i) {
+        vm::vec4 r = vm::normal(vectors4[i & MASK]);
+        keep(r);
+    });
+    bench("fov", [&](std::size_t i) {
+        vm::mat4 r = vm::fov<float>(30.f + angles[i & MASK], 1.5f, .1f, 500.f);
+        keep(r);
+    });
+
+    /* v3d meshes, cpu side only. no GL context is needed until upload() */
+
+    unsigned int const counts[][2] = { {8, 8}, {16, 16}, {32, 32}, {64, 64}, {128, 128} };
+    for(auto const & c : counts)
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "SolidSphere %ux%u", c[0], c[1]);
+        bench(name, [&](std::size_t) {
+            v3d::SolidSphere sphere(1.f, c[0], c[1]);
+            keep(sphere);
+        });
+    }
+    for(auto const & c : counts)
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "SolidTorus %ux%u", c[0], c[1]);
+        bench(name, [&](std::size_t) {
+            v3d::SolidTorus torus(1.f, .5f, c[0], c[1]);
+            keep(torus);
+        });
+    }
+    for(unsigned int subdivisions = 1; subdivisions <= 5; subdivisions++)
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "SolidIcosphere %u", subdivisions);
+        bench(name, [&](std::size_t) {
+            v3d::SolidIcosphere sphere(1.f, subdivisions);
+            keep(sphere);
+        });
+    }
+    for(unsigned int divisions : {4u, 8u, 16u, 32u, 64u})
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "SolidCubeSphere %u", divisions);
+        bench(name, [&](std::size_t) {
+            v3d::SolidCubeSphere sphere(1.f, divisions);
+            keep(sphere);
+        });
+    }
+
+    /* v3d mesh optimization, on the icosphere which keeps its generated order */
+
+    v3d::SolidIcosphere const icosphere(1.f, 4);
+    std::vector<GLuint> indices;
+    bench("optimizeVertexCache icosphere 4", [&](std::size_t) {
+        indices = icosphere.getIndices();
+        v3d::optimizeVertexCache(indices, icosphere.getVertices().size());
+        keep(indices);
+    });
+    bench("optimizeVertexFetch icosphere 4", [&](std::size_t) {
+        v3d::VertexArray vertices = icosphere.getVertices();
+        indices = icosphere.getIndices();
+        keep(v3d::optimizeVertexFetch(vertices, indices));
+    });
+    bench("stripify icosphere 4", [&](std::size_t) {
+        keep(v3d::stripify(icosphere.getIndices()));
+    });
+
+    for(auto const & c : counts)
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "acmr SolidSphere %ux%u", c[0], c[1]);
+        cacheStats(name, v3d::SolidSphere(1.f, c[0], c[1]));
+        std::snprintf(name, sizeof(name), "acmr SolidTorus %ux%u", c[0], c[1]);
+        cacheStats(name, v3d::SolidTorus(1.f, .5f, c[0], c[1]));
+    }
+    for(unsigned int subdivisions = 1; subdivisions <= 5; subdivisions++)
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "acmr SolidIcosphere %u", subdivisions);
+        cacheStats(name, v3d::SolidIcosphere(1.f, subdivisions));
+    }
+    for(unsigned int divisions : {4u, 16u, 64u})
+    {
+        char name[64];
+        std::snprintf(name, sizeof(name), "acmr SolidCubeSphere %u", divisions);
+        cacheStats(name, v3d::SolidCubeSphere(1.f, divisions));
+    }
+    return 0;
+}